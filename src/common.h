@@ -0,0 +1,147 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <functional>
+
+#define PI32 3.1415926535f
+
+#define ASSERT(EX) ((EX) ? 1 : (*(volatile int*)0 = 0), 0)
+
+#define ARRAY_SIZE(A) (sizeof(A) / sizeof((A)[0]))
+
+#define CONCAT_(X, Y) X##Y
+#define CONCAT(X, Y) CONCAT_(X, Y)
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+typedef int8_t  i8;
+typedef int16_t i16;
+typedef int32_t i32;
+typedef int64_t i64;
+
+#define DEFER(STATEMENT) DeferStatement CONCAT(defer_statement, CONCAT(__LINE__, CONCAT(_, __COUNTER__)))([&]{STATEMENT;})
+class DeferStatement
+{
+    std::function<void()> lambda;
+    
+    public:
+    DeferStatement(std::function<void()> lambda)
+    {
+        this->lambda = lambda;
+    }
+    
+    ~DeferStatement()
+    {
+        this->lambda();
+    }
+};
+
+#if defined(_WIN32) && defined(_WIN64)
+
+#define STRICT
+#define WIN32_LEAN_AND_MEAN 1
+#define NOMINMAX            1
+
+#include <windows.h>
+#include <timeapi.h>
+#include <sys/stat.h>
+
+#undef STRICT
+#undef WIN32_LEAN_AND_MEAN
+#undef NOMINMAX
+#undef far
+#undef near
+
+u64
+GetTicks()
+{
+    LARGE_INTEGER result;
+    QueryPerformanceCounter(&result);
+    return result.QuadPart;
+}
+
+float
+DiffTicksInMs(u64 start, u64 end)
+{
+    static float res_perf_freq = 0;
+    if (res_perf_freq == 0)
+    {
+        LARGE_INTEGER perf_freq;
+        QueryPerformanceFrequency(&perf_freq);
+        res_perf_freq = 1.0f / (float)perf_freq.QuadPart;
+    }
+    
+    return res_perf_freq*(1000*(end - start));
+}
+
+bool
+SeekFile(FILE* file, u64 offset)
+{
+    return (_fseeki64(file, (__int64)offset, SEEK_SET) == 0);
+}
+
+u64
+GetFileSize(FILE* file)
+{
+    _fseeki64(file, 0, SEEK_END);
+    u64 size = (u64)_ftelli64(file);
+    rewind(file);
+    
+    return size;
+}
+
+u64
+GetFileModifiedTime(char* path)
+{
+    struct _stat64 result;
+    return (_stat64(path, &result) == 0 ? (u64)result.st_mtime : 0);
+}
+#elif defined(__unix__)
+#include <time.h>
+#include <sys/stat.h>
+u64
+GetTicks()
+{
+    struct timespec result;
+    clock_gettime(CLOCK_REALTIME, &result);
+    return (u64)result.tv_nsec;
+}
+
+float
+DiffTicksInMs(u64 start, u64 end)
+{
+    return (float)(end - start) / 1000;
+}
+
+bool
+SeekFile(FILE* file, u64 offset)
+{
+    return (fseeko(file, (off_t)offset, SEEK_SET) == 0);
+}
+
+u64
+GetFileSize(FILE* file)
+{
+    fseeko(file, 0, SEEK_END);
+    u64 size = (u64)ftello(file);
+    rewind(file);
+    
+    return size;
+}
+
+u64
+GetFileModifiedTime(char* path)
+{
+    struct stat result;
+    return (stat(path, &result) == 0 ? (u64)result.st_mtime : 0);
+}
+#else
+#error Unsupported platform
+#endif
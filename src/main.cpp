@@ -1,6 +1,4 @@
-#include <stdio.h>
-#include <stdint.h>
-#include <functional>
+#include "common.h"
 
 #include "GL/glew.h"
 
@@ -11,96 +9,10 @@
 #include "imgui_impl_sdl2.h"
 #include "imgui_impl_opengl3.h"
 
-#define PI32 3.1415926535f
+#include "scene_pages.h"
 
-#define ASSERT(EX) ((EX) ? 1 : (*(volatile int*)0 = 0), 0)
-
-#define ARRAY_SIZE(A) (sizeof(A) / sizeof((A)[0]))
-
-#define CONCAT_(X, Y) X##Y
-#define CONCAT(X, Y) CONCAT_(X, Y)
-
-typedef uint8_t  u8;
-typedef uint16_t u16;
-typedef uint32_t u32;
-typedef uint64_t u64;
-
-typedef int8_t  i8;
-typedef int16_t i16;
-typedef int32_t i32;
-typedef int64_t i64;
-
-#define DEFER(STATEMENT) DeferStatement CONCAT(defer_statement, CONCAT(__LINE__, CONCAT(_, __COUNTER__)))([&]{STATEMENT;})
-class DeferStatement
-{
-    std::function<void()> lambda;
-    
-    public:
-    DeferStatement(std::function<void()> lambda)
-    {
-        this->lambda = lambda;
-    }
-    
-    ~DeferStatement()
-    {
-        this->lambda();
-    }
-};
-
-#if defined(_WIN32) && defined(_WIN64)
-
-#define STRICT
-#define WIN32_LEAN_AND_MEAN 1
-#define NOMINMAX            1
-
-#include <windows.h>
-#include <timeapi.h>
-
-#undef STRICT
-#undef WIN32_LEAN_AND_MEAN
-#undef NOMINMAX
-#undef far
-#undef near
-
-u64
-GetTicks()
-{
-    LARGE_INTEGER result;
-    QueryPerformanceCounter(&result);
-    return result.QuadPart;
-}
-
-float
-DiffTicksInMs(u64 start, u64 end)
-{
-    static float res_perf_freq = 0;
-    if (res_perf_freq == 0)
-    {
-        LARGE_INTEGER perf_freq;
-        QueryPerformanceFrequency(&perf_freq);
-        res_perf_freq = 1.0f / (float)perf_freq.QuadPart;
-    }
-    
-    return res_perf_freq*(1000*(end - start));
-}
-#elif defined(__unix__)
-#include <time.h>
-u64
-GetTicks()
-{
-    struct timespec result;
-    clock_gettime(CLOCK_REALTIME, &result);
-    return (u64)result.tv_nsec;
-}
-
-float
-DiffTicksInMs(u64 start, u64 end)
-{
-    return (float)(end - start) / 1000;
-}
-#else
-#error Unsupported platform
-#endif
+// NOTE: must match MAX_NUMBER_OF_BOUNCES in compute_shader.comp
+#define MAX_NUMBER_OF_BOUNCES 64
 
 void
 GLDebugProc(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *message, const void *userParam)
@@ -173,6 +85,59 @@ char* SceneNames[] = {
 	"cornell_cup",
 };
 
+struct Scene_Page_Loader
+{
+	SDL_Thread* thread;
+	SDL_mutex* mutex;
+	SDL_cond* cond;
+	bool should_quit;
+};
+
+#define EXPORT_SLOT_COUNT 3
+
+#define ExportFormat_PNG 0
+#define ExportFormat_PFM 1
+#define ExportFormat_EXR 2
+
+const char* ExportFormatNames[] = {
+	"png",
+	"pfm",
+	"exr",
+};
+
+#define ExportSlot_Free    0
+#define ExportSlot_Reading 1
+#define ExportSlot_Writing 2
+
+struct Export_Slot
+{
+	GLuint pbo;
+	GLsync fence;
+	float* pixels;
+	u64 capacity;
+
+	u32 state;
+	u32 sequence;
+	int width;
+	int height;
+	u32 format;
+	char path[1024];
+};
+
+struct Image_Exporter
+{
+	SDL_Thread* writer_thread;
+	SDL_mutex* mutex;
+	SDL_cond* cond;
+	bool writer_should_quit;
+
+	Export_Slot slots[EXPORT_SLOT_COUNT];
+	u32 next_sequence;
+
+	u32 written_count;
+	u32 dropped_count;
+};
+
 struct State
 {
     int current_resolution_index;
@@ -180,7 +145,13 @@ struct State
     int backbuffer_height;
 		char* current_scene;
 		int number_of_bounces;
+		int russian_roulette_depth;
 		bool enable_dispersion;
+		int geometry_budget_kb;
+		int loaded_geometry_budget_kb;
+		u32 export_format;
+		int export_interval;
+		bool should_take_screenshot;
     
     GLuint display_vao;
     GLuint display_program;
@@ -194,142 +165,816 @@ struct State
 		GLuint object_data;
 		GLuint material_data;
 		GLuint lights;
+		GLuint pages;
+		GLuint page_feedback;
+
+		Scene_Pager pager;
+		Scene_Page_Loader page_loader;
+		Image_Exporter exporter;
     
     bool should_regen_buffers;
     u32 frame_index;
     
     u64 last_render_timestamp;
     float last_render_time;
-};
 
-struct Triangle_Data
-{
-	float p0p2x[4];
-	float p1p2y[4];
-	float p2z[4];
+		GLuint trace_time_query;
+		float last_trace_time;
+
+		bool is_benchmarking;
+		int benchmark_samples;
+		u32 benchmark_scene_index;
+		double benchmark_trace_time;
+		bool benchmark_restore_dispersion;
 };
 
-struct Triangle_Material_Data
+int
+PageLoaderProc(void* data)
 {
-	float n0n2x[4];
-	float n1n2y[4];
-	float n2zmat[4];
-};
+	State* state              = (State*)data;
+	Scene_Pager* pager        = &state->pager;
+	Scene_Page_Loader* loader = &state->page_loader;
+
+	SDL_LockMutex(loader->mutex);
+	while (!loader->should_quit)
+	{
+		Scene_Page_Staging* staging = 0;
+		for (int i = 0; i < SCENE_PAGE_STAGING_COUNT; ++i)
+		{
+			if (pager->staging[i].state == PageStaging_Requested)
+			{
+				staging = &pager->staging[i];
+				break;
+			}
+		}
+
+		if (staging == 0) SDL_CondWait(loader->cond, loader->mutex);
+		else
+		{
+			u32 page = staging->page;
+
+			SDL_UnlockMutex(loader->mutex);
+			bool loaded = ReadScenePage(pager, page, staging->data);
+			SDL_LockMutex(loader->mutex);
+
+			if (!loaded) fprintf(stderr, "ERROR: failed to read scene page %u.\n", page);
+
+			staging->state = (loaded ? PageStaging_Loaded : PageStaging_Free);
+		}
+	}
+	SDL_UnlockMutex(loader->mutex);
+
+	return 0;
+}
 
-struct Bounding_Sphere
+void
+UnloadScenePages(State* state)
 {
-	float pr[4];
-};
+	Scene_Page_Loader* loader = &state->page_loader;
 
-struct Material
+	if (loader->thread != 0)
+	{
+		SDL_LockMutex(loader->mutex);
+		loader->should_quit = true;
+		SDL_CondSignal(loader->cond);
+		SDL_UnlockMutex(loader->mutex);
+
+		SDL_WaitThread(loader->thread, 0);
+	}
+
+	if (loader->mutex != 0) SDL_DestroyMutex(loader->mutex);
+	if (loader->cond  != 0) SDL_DestroyCond(loader->cond);
+	*loader = {};
+
+	CloseScenePages(&state->pager);
+}
+
+// NOTE: Upload_Scene_Page_Proc, copies a page into its slot of the triangle buffers and updates the page table
+void
+UploadScenePage(void* user_data, u32 page, i32 slot, i32 evicted_page, Scene_Page_Data* data)
 {
-	float color[4];
-	u32 kind;
-	u32 _pad_0[3];
-};
+	State* state       = (State*)user_data;
+	Scene_Pager* pager = &state->pager;
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->pages);
+	if (evicted_page != -1) glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(Scene_Page)*evicted_page, sizeof(Scene_Page), &pager->pages[evicted_page]);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(Scene_Page)*page, sizeof(Scene_Page), &pager->pages[page]);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->triangle_data);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(data->tri_data)*slot, sizeof(data->tri_data), data->tri_data);
 
-struct Light
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->triangle_mat_data);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(data->tri_mat_data)*slot, sizeof(data->tri_mat_data), data->tri_mat_data);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->bounding_spheres);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(data->bounding_spheres)*slot, sizeof(data->bounding_spheres), data->bounding_spheres);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// NOTE: Called once per frame after the gpu is done. Reads back how many rays entered each page, uploads pages the
+//       loader has finished reading and hands the hottest missing pages to the loader. Returns true when the set of
+//       resident pages changed, since the accumulated image is then no longer of the same scene.
+bool
+UpdateScenePages(State* state)
 {
-  float p0nx[4];
-  float p1ny[4];
-  float p2nz[4];
-  float areaidmat[4];
-};
+	Scene_Pager* pager        = &state->pager;
+	Scene_Page_Loader* loader = &state->page_loader;
+
+	// NOTE: everything is resident, there is nothing to stream
+	if (pager->slot_count == pager->page_count) return false;
+
+	u32 zero = 0;
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->page_feedback);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(u32)*pager->page_count, pager->page_feedback);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	ProcessPageFeedback(pager, pager->page_feedback);
+
+	SDL_LockMutex(loader->mutex);
+	bool residency_changed = MakeLoadedPagesResident(pager, UploadScenePage, state);
+	if (RequestMissingPages(pager, pager->page_feedback)) SDL_CondSignal(loader->cond);
+	SDL_UnlockMutex(loader->mutex);
+
+	return residency_changed;
+}
 
 bool
 LoadScene(State* state, char* scene_name)
 {
-	char buffer[1024] = {};
+	char scene_path[1024]       = {};
+	char paged_path[1024]       = {};
+	char local_paged_path[1024] = {};
 	{
-		int written = snprintf(buffer, sizeof(buffer), "../misc/%s.scene", scene_name);
-		if (written < 0 || written == sizeof(buffer))
+		int written = snprintf(scene_path, sizeof(scene_path), "../misc/%s.scene", scene_name);
+		if (written < 0 || written == sizeof(scene_path))
 		{
 			fprintf(stderr, "ERROR: failed to create path to scene file.\n");
 			return false;
 		}
+
+		written = snprintf(paged_path, sizeof(paged_path), "../misc/%s.pscene", scene_name);
+		if (written < 0 || written == sizeof(paged_path))
+		{
+			fprintf(stderr, "ERROR: failed to create path to paged scene file.\n");
+			return false;
+		}
+
+		written = snprintf(local_paged_path, sizeof(local_paged_path), "%s.pscene", scene_name);
+		if (written < 0 || written == sizeof(local_paged_path))
+		{
+			fprintf(stderr, "ERROR: failed to create path to paged scene file.\n");
+			return false;
+		}
 	}
 
-	FILE* scene_file = fopen(buffer, "rb");
-	DEFER(if (scene_file != 0) fclose(scene_file));
+	// NOTE: the paged scene is cached next to the scene, or in the working directory when misc is read only. It is
+	//       opened before the current scene is unloaded, so a scene that fails to open leaves the current one intact.
+	Scene_Pager new_pager = {};
+	char* paged_paths[]   = {paged_path, local_paged_path};
+	if (!OpenScenePages(&new_pager, scene_path, paged_paths, ARRAY_SIZE(paged_paths), (u64)state->geometry_budget_kb*1024)) return false;
 
-	if (scene_file == 0)
+	Scene_Pager* pager = &state->pager;
+	UnloadScenePages(state);
+	*pager = new_pager;
+
+	if (state->triangle_data != 0) glDeleteBuffers(1, &state->triangle_data);
+	glGenBuffers(1, &state->triangle_data);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->triangle_data);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(Triangle_Data)*SCENE_PAGE_TRIANGLE_COUNT*pager->slot_count, 0, GL_DYNAMIC_STORAGE_BIT);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, state->triangle_data);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	if (state->triangle_mat_data != 0) glDeleteBuffers(1, &state->triangle_mat_data);
+	glGenBuffers(1, &state->triangle_mat_data);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->triangle_mat_data);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(Triangle_Material_Data)*SCENE_PAGE_TRIANGLE_COUNT*pager->slot_count, 0, GL_DYNAMIC_STORAGE_BIT);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, state->triangle_mat_data);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	if (state->bounding_spheres != 0) glDeleteBuffers(1, &state->bounding_spheres);
+	glGenBuffers(1, &state->bounding_spheres);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->bounding_spheres);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(Bounding_Sphere)*SCENE_PAGE_TRIANGLE_COUNT*pager->slot_count, 0, GL_DYNAMIC_STORAGE_BIT);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, state->bounding_spheres);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	if (state->material_data != 0) glDeleteBuffers(1, &state->material_data);
+	glGenBuffers(1, &state->material_data);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->material_data);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(Material)*pager->mat_count, pager->materials, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, state->material_data);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	if (state->lights != 0) glDeleteBuffers(1, &state->lights);
+	glGenBuffers(1, &state->lights);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->lights);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(Light)*pager->light_count, pager->lights, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, state->lights);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	if (state->pages != 0) glDeleteBuffers(1, &state->pages);
+	glGenBuffers(1, &state->pages);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->pages);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(Scene_Page)*pager->page_count, pager->pages, GL_DYNAMIC_STORAGE_BIT);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, state->pages);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	if (state->page_feedback != 0) glDeleteBuffers(1, &state->page_feedback);
+	glGenBuffers(1, &state->page_feedback);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->page_feedback);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(u32)*pager->page_count, pager->page_feedback, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, state->page_feedback);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	// NOTE: fill the budget up front so scenes that fit behave exactly like before, the rest is streamed in on demand
+	for (u32 page = 0; page < pager->slot_count; ++page)
 	{
-		fprintf(stderr, "ERROR: failed to open scene file.\n");
+		Scene_Page_Data* data = pager->staging[0].data;
+		if (!ReadScenePage(pager, page, data))
+		{
+			fprintf(stderr, "ERROR: failed to read scene page %u.\n", page);
+			UnloadScenePages(state);
+			return false;
+		}
+
+		i32 slot         = ChooseEvictionSlot(pager);
+		i32 evicted_page = AssignPageToSlot(pager, page, slot);
+		UploadScenePage(state, page, slot, evicted_page, data);
+	}
+
+	Scene_Page_Loader* loader = &state->page_loader;
+	loader->mutex  = SDL_CreateMutex();
+	loader->cond   = SDL_CreateCond();
+	loader->thread = SDL_CreateThread(PageLoaderProc, "page loader", state);
+	if (loader->mutex == 0 || loader->cond == 0 || loader->thread == 0)
+	{
+		fprintf(stderr, "ERROR: failed to start page loader. %s\n", SDL_GetError());
+		UnloadScenePages(state);
 		return false;
 	}
-	else
+
+	state->loaded_geometry_budget_kb = state->geometry_budget_kb;
+
+	return true;
+}
+
+// NOTE: Loads another scene, or the current one with a new budget, from the ui. When that fails the previous scene and
+//       budget are restored, and reloaded if the failure happened after they were unloaded, so the ui never shows a
+//       scene name that doesn't match the buffers being rendered.
+void
+SwitchScene(State* state, char* scene_name)
+{
+	char* previous_scene = state->current_scene;
+
+	state->current_scene        = scene_name;
+	state->should_regen_buffers = true;
+	if (LoadScene(state, scene_name)) return;
+
+	fprintf(stderr, "ERROR: failed to load scene %s, going back to %s.\n", scene_name, previous_scene);
+
+	state->current_scene      = previous_scene;
+	state->geometry_budget_kb = state->loaded_geometry_budget_kb;
+	if (state->pager.file == 0 && !LoadScene(state, previous_scene))
 	{
-		fseek(scene_file, 0, SEEK_END);
-		int scene_file_size = ftell(scene_file);
-		rewind(scene_file);
+		fprintf(stderr, "ERROR: failed to reload scene %s.\n", previous_scene);
+	}
+}
 
-		u8* scene_data = (u8*)malloc(scene_file_size + 1);
-		memset(scene_data, 0, scene_file_size + 1);
-		DEFER(free(scene_data));
+u8
+TonemapToU8(float value)
+{
+	// NOTE: matches what the display program shows, the backbuffer is drawn to the (non srgb) default framebuffer as is
+	float clamped = (value < 0 ? 0 : (value > 1 ? 1 : value));
+	return (u8)(clamped*255 + 0.5f);
+}
 
-		if (fread(scene_data, 1, scene_file_size, scene_file) != scene_file_size)
+u32
+Crc32(u32 crc, const u8* data, u64 size)
+{
+	static u32 table[256];
+	static bool table_initialized = false;
+	if (!table_initialized)
+	{
+		for (u32 i = 0; i < 256; ++i)
 		{
-			fprintf(stderr, "ERROR: failed to read scene file.\n");
-			return false;
+			u32 c = i;
+			for (int j = 0; j < 8; ++j) c = (c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1);
+			table[i] = c;
+		}
+
+		table_initialized = true;
+	}
+
+	crc = ~crc;
+	for (u64 i = 0; i < size; ++i) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+void
+PutU32BE(u8* dst, u32 value)
+{
+	dst[0] = (u8)(value >> 24);
+	dst[1] = (u8)(value >> 16);
+	dst[2] = (u8)(value >> 8);
+	dst[3] = (u8)(value >> 0);
+}
+
+bool
+WritePNGChunk(FILE* file, const char* type, u8* data, u32 size)
+{
+	u8 size_be[4];
+	u8 crc_be[4];
+	PutU32BE(size_be, size);
+	PutU32BE(crc_be, Crc32(Crc32(0, (const u8*)type, 4), data, size));
+
+	return (fwrite(size_be, 4, 1, file) == 1                      &&
+					fwrite(type, 4, 1, file) == 1                         &&
+					(size == 0 || fwrite(data, size, 1, file) == 1)       &&
+					fwrite(crc_be, 4, 1, file) == 1);
+}
+
+// NOTE: 8 bit rgb, the image data is wrapped in stored (uncompressed) deflate blocks, which keeps the encoder trivial
+//       at the cost of file size
+bool
+WritePNG(FILE* file, float* pixels, int width, int height)
+{
+	u64 row_size   = 1 + 3*(u64)width;
+	u64 raw_size   = row_size*height;
+	u64 block_size = 65535;
+	u64 zlib_size  = 2 + raw_size + 5*(raw_size/block_size + 1) + 4;
+	if (zlib_size > 0x7FFFFFFF) return false;
+
+	u8* raw = (u8*)malloc(raw_size);
+	DEFER(free(raw));
+
+	u8* zlib = (u8*)malloc(zlib_size);
+	DEFER(free(zlib));
+
+	// NOTE: png rows go top to bottom, opengl rows bottom to top
+	for (int y = 0; y < height; ++y)
+	{
+		u8* row    = raw + row_size*y;
+		float* src = pixels + 4*(u64)width*(height - 1 - y);
+
+		row[0] = 0;
+		for (int x = 0; x < width; ++x)
+		{
+			row[1 + 3*x + 0] = TonemapToU8(src[4*x + 0]);
+			row[1 + 3*x + 1] = TonemapToU8(src[4*x + 1]);
+			row[1 + 3*x + 2] = TonemapToU8(src[4*x + 2]);
+		}
+	}
+
+	u8* cursor = zlib;
+	*cursor++ = 0x78;
+	*cursor++ = 0x01;
+
+	u64 remaining = raw_size;
+	u8* src       = raw;
+	do
+	{
+		u16 len = (u16)(remaining < block_size ? remaining : block_size);
+		remaining -= len;
+
+		*cursor++ = (remaining == 0);
+		*cursor++ = (u8)(len >> 0);
+		*cursor++ = (u8)(len >> 8);
+		*cursor++ = (u8)(~len >> 0);
+		*cursor++ = (u8)(~len >> 8);
+		memcpy(cursor, src, len);
+
+		cursor += len;
+		src    += len;
+	} while (remaining != 0);
+
+	u32 a = 1;
+	u32 b = 0;
+	for (u64 i = 0; i < raw_size; ++i)
+	{
+		a = (a + raw[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+
+	PutU32BE(cursor, (b << 16) | a);
+	cursor += 4;
+
+	u8 header[13];
+	PutU32BE(header + 0, (u32)width);
+	PutU32BE(header + 4, (u32)height);
+	header[8]  = 8; // NOTE: bit depth
+	header[9]  = 2; // NOTE: color type rgb
+	header[10] = 0;
+	header[11] = 0;
+	header[12] = 0;
+
+	u8 signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+	return (fwrite(signature, sizeof(signature), 1, file) == 1      &&
+					WritePNGChunk(file, "IHDR", header, sizeof(header))     &&
+					WritePNGChunk(file, "IDAT", zlib, (u32)(cursor - zlib)) &&
+					WritePNGChunk(file, "IEND", 0, 0));
+}
+
+// NOTE: linear rgb floats, pfm rows go bottom to top like opengl's
+bool
+WritePFM(FILE* file, float* pixels, int width, int height)
+{
+	float* row = (float*)malloc(sizeof(float)*3*width);
+	DEFER(free(row));
+
+	bool succeeded = (fprintf(file, "PF\n%d %d\n-1.0\n", width, height) > 0);
+	for (int y = 0; y < height && succeeded; ++y)
+	{
+		float* src = pixels + 4*(u64)width*y;
+		for (int x = 0; x < width; ++x)
+		{
+			row[3*x + 0] = src[4*x + 0];
+			row[3*x + 1] = src[4*x + 1];
+			row[3*x + 2] = src[4*x + 2];
+		}
+
+		succeeded = (fwrite(row, sizeof(float)*3, width, file) == (size_t)width);
+	}
+
+	return succeeded;
+}
+
+bool
+WriteEXRAttribute(FILE* file, const char* name, const char* type, void* value, u32 size)
+{
+	return (fwrite(name, strlen(name) + 1, 1, file) == 1 &&
+					fwrite(type, strlen(type) + 1, 1, file) == 1 &&
+					fwrite(&size, sizeof(size), 1, file) == 1    &&
+					fwrite(value, size, 1, file) == 1);
+}
+
+// NOTE: linear rgb floats in an uncompressed single part scanline exr, one scanline per chunk. Everything in the
+//       format is little endian, which is assumed to be the host byte order.
+bool
+WriteEXR(FILE* file, float* pixels, int width, int height)
+{
+	u8 channels[3*18 + 1] = {};
+	{
+		// NOTE: channels must be sorted by name
+		const char* names = "BGR";
+		for (int i = 0; i < 3; ++i)
+		{
+			u8* channel = channels + 18*i;
+			i32 pixel_type = 2; // NOTE: FLOAT
+			i32 sampling   = 1;
+
+			channel[0] = names[i];
+			channel[1] = 0;
+			memcpy(channel + 2,  &pixel_type, 4);
+			memcpy(channel + 10, &sampling,   4);
+			memcpy(channel + 14, &sampling,   4);
+		}
+	}
+
+	i32 window[4]          = {0, 0, width - 1, height - 1};
+	u8 compression         = 0;
+	u8 line_order          = 0;
+	float aspect_ratio     = 1;
+	float window_center[2] = {0, 0};
+	float window_width     = 1;
+
+	u32 magic_version[2] = {20000630, 2};
+
+	bool succeeded = (fwrite(magic_version, sizeof(magic_version), 1, file) == 1                                             &&
+										WriteEXRAttribute(file, "channels", "chlist", channels, sizeof(channels))                            &&
+										WriteEXRAttribute(file, "compression", "compression", &compression, sizeof(compression))             &&
+										WriteEXRAttribute(file, "dataWindow", "box2i", window, sizeof(window))                               &&
+										WriteEXRAttribute(file, "displayWindow", "box2i", window, sizeof(window))                            &&
+										WriteEXRAttribute(file, "lineOrder", "lineOrder", &line_order, sizeof(line_order))                   &&
+										WriteEXRAttribute(file, "pixelAspectRatio", "float", &aspect_ratio, sizeof(aspect_ratio))            &&
+										WriteEXRAttribute(file, "screenWindowCenter", "v2f", window_center, sizeof(window_center))           &&
+										WriteEXRAttribute(file, "screenWindowWidth", "float", &window_width, sizeof(window_width))           &&
+										fputc(0, file) != EOF);
+
+	u64 header_size = ftell(file);
+	u64 chunk_size  = 8 + sizeof(float)*3*(u64)width;
+	for (int y = 0; y < height && succeeded; ++y)
+	{
+		u64 offset = header_size + sizeof(u64)*height + chunk_size*y;
+		succeeded = (fwrite(&offset, sizeof(offset), 1, file) == 1);
+	}
+
+	float* line = (float*)malloc(sizeof(float)*3*width);
+	DEFER(free(line));
+
+	// NOTE: exr scanlines go top to bottom, opengl rows bottom to top
+	for (int y = 0; y < height && succeeded; ++y)
+	{
+		float* src = pixels + 4*(u64)width*(height - 1 - y);
+		for (int x = 0; x < width; ++x)
+		{
+			line[0*width + x] = src[4*x + 2];
+			line[1*width + x] = src[4*x + 1];
+			line[2*width + x] = src[4*x + 0];
+		}
+
+		i32 line_header[2] = {y, (i32)(sizeof(float)*3*width)};
+		succeeded = (fwrite(line_header, sizeof(line_header), 1, file) == 1 &&
+								 fwrite(line, sizeof(float)*3*width, 1, file) == 1);
+	}
+
+	return succeeded;
+}
+
+int
+ImageWriterProc(void* data)
+{
+	Image_Exporter* exporter = (Image_Exporter*)data;
+
+	SDL_LockMutex(exporter->mutex);
+	for (;;)
+	{
+		Export_Slot* slot = 0;
+		for (int i = 0; i < EXPORT_SLOT_COUNT; ++i)
+		{
+			Export_Slot* candidate = &exporter->slots[i];
+			if (candidate->state == ExportSlot_Writing && (slot == 0 || candidate->sequence < slot->sequence)) slot = candidate;
+		}
+
+		// NOTE: drain every queued image before quitting, so long renders don't lose their last frames on exit
+		if (slot == 0)
+		{
+			if (exporter->writer_should_quit) break;
+			else                              SDL_CondWait(exporter->cond, exporter->mutex);
 		}
 		else
 		{
-			u32 tri_count   = ((u32*)scene_data)[0];
-			u32 mat_count   = ((u32*)scene_data)[1];
-			u32 light_count = ((u32*)scene_data)[2];
-
-			Triangle_Data* tri_data              =          (Triangle_Data*)(scene_data       + 12);
-			Triangle_Material_Data* tri_mat_data = (Triangle_Material_Data*)(tri_data         + tri_count);
-			Bounding_Sphere* bounding_spheres    =        (Bounding_Sphere*)(tri_mat_data     + tri_count);
-			Material* materials                  =               (Material*)(bounding_spheres + tri_count);
-			Light* lights                        =                  (Light*)(materials        + mat_count);
-
-			if (state->triangle_data != 0) glDeleteBuffers(1, &state->triangle_data);
-			glGenBuffers(1, &state->triangle_data);
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->triangle_data);
-			glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(Triangle_Data)*tri_count, tri_data, 0);
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, state->triangle_data);
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
-			if (state->triangle_mat_data != 0) glDeleteBuffers(1, &state->triangle_mat_data);
-			glGenBuffers(1, &state->triangle_mat_data);
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->triangle_mat_data);
-			glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(Triangle_Material_Data)*tri_count, tri_mat_data, 0);
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, state->triangle_mat_data);
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
-			if (state->bounding_spheres != 0) glDeleteBuffers(1, &state->bounding_spheres);
-			glGenBuffers(1, &state->bounding_spheres);
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->bounding_spheres);
-			glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(Bounding_Sphere)*tri_count, bounding_spheres, 0);
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, state->bounding_spheres);
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
-			if (state->material_data != 0) glDeleteBuffers(1, &state->material_data);
-			glGenBuffers(1, &state->material_data);
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->material_data);
-			glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(Material)*mat_count, materials, 0);
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, state->material_data);
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
-			if (state->lights != 0) glDeleteBuffers(1, &state->lights);
-			glGenBuffers(1, &state->lights);
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->lights);
-			glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(Light)*light_count, lights, 0);
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, state->lights);
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+			SDL_UnlockMutex(exporter->mutex);
+
+			bool written = false;
+			FILE* file   = fopen(slot->path, "wb");
+			if (file != 0)
+			{
+				switch (slot->format)
+				{
+					case ExportFormat_PNG: written = WritePNG(file, slot->pixels, slot->width, slot->height); break;
+					case ExportFormat_PFM: written = WritePFM(file, slot->pixels, slot->width, slot->height); break;
+					case ExportFormat_EXR: written = WriteEXR(file, slot->pixels, slot->width, slot->height); break;
+				}
+
+				written = (fclose(file) == 0 && written);
+			}
+
+			if (!written) fprintf(stderr, "ERROR: failed to write image %s.\n", slot->path);
+
+			SDL_LockMutex(exporter->mutex);
+			exporter->written_count += written;
+			slot->state = ExportSlot_Free;
+		}
+	}
+	SDL_UnlockMutex(exporter->mutex);
+
+	return 0;
+}
+
+bool
+StartImageExporter(Image_Exporter* exporter)
+{
+	exporter->mutex         = SDL_CreateMutex();
+	exporter->cond          = SDL_CreateCond();
+	exporter->writer_thread = SDL_CreateThread(ImageWriterProc, "image writer", exporter);
+	if (exporter->mutex == 0 || exporter->cond == 0 || exporter->writer_thread == 0)
+	{
+		fprintf(stderr, "ERROR: failed to start image writer. %s\n", SDL_GetError());
+		return false;
+	}
+
+	return true;
+}
+
+// NOTE: Hands readbacks the gpu has finished to the writer thread. Only polls the fences, unless wait is set, which is
+//       used on exit to flush everything still in flight.
+void
+UpdateImageExports(Image_Exporter* exporter, bool wait)
+{
+	if (exporter->mutex == 0) return;
+
+	bool queued_images = false;
+
+	SDL_LockMutex(exporter->mutex);
+	for (int i = 0; i < EXPORT_SLOT_COUNT; ++i)
+	{
+		Export_Slot* slot = &exporter->slots[i];
+		if (slot->state != ExportSlot_Reading) continue;
+
+		GLenum status = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, (wait ? 1000000000 : 0));
+		if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+		{
+			glDeleteSync(slot->fence);
+			slot->fence   = 0;
+			slot->state   = ExportSlot_Writing;
+			queued_images = true;
+		}
+	}
+
+	if (queued_images) SDL_CondSignal(exporter->cond);
+	SDL_UnlockMutex(exporter->mutex);
+}
+
+void
+StopImageExporter(Image_Exporter* exporter)
+{
+	UpdateImageExports(exporter, true);
+
+	if (exporter->writer_thread != 0)
+	{
+		SDL_LockMutex(exporter->mutex);
+		exporter->writer_should_quit = true;
+		SDL_CondSignal(exporter->cond);
+		SDL_UnlockMutex(exporter->mutex);
+
+		SDL_WaitThread(exporter->writer_thread, 0);
+	}
+
+	if (exporter->mutex != 0) SDL_DestroyMutex(exporter->mutex);
+	if (exporter->cond  != 0) SDL_DestroyCond(exporter->cond);
+
+	for (int i = 0; i < EXPORT_SLOT_COUNT; ++i)
+	{
+		if (exporter->slots[i].fence != 0) glDeleteSync(exporter->slots[i].fence);
+		if (exporter->slots[i].pbo   != 0) glDeleteBuffers(1, &exporter->slots[i].pbo);
+	}
+
+	*exporter = {};
+}
+
+// NOTE: Queues an asynchronous readback of the backbuffer into the next free pixel buffer in the ring. The pixel buffers
+//       are persistently mapped, so once the fence has passed the writer thread reads them directly. When every slot
+//       is still busy the export is dropped instead of stalling the render loop.
+bool
+RequestImageExport(State* state, u32 sample_count)
+{
+	Image_Exporter* exporter = &state->exporter;
+	if (exporter->mutex == 0) return false;
+
+	Export_Slot* slot = 0;
+	SDL_LockMutex(exporter->mutex);
+	for (int i = 0; i < EXPORT_SLOT_COUNT; ++i)
+	{
+		if (exporter->slots[i].state == ExportSlot_Free)
+		{
+			slot = &exporter->slots[i];
+			break;
+		}
+	}
+	if (slot == 0) exporter->dropped_count += 1;
+	SDL_UnlockMutex(exporter->mutex);
+
+	if (slot == 0)
+	{
+		fprintf(stderr, "WARNING: all export slots are busy, dropped export of sample %u.\n", sample_count);
+		return false;
+	}
+
+	// NOTE: the sequence number keeps exports of the same scene, resolution and sample count (e.g. after resetting the
+	//       accumulation) from overwriting each other
+	u32 sequence = exporter->next_sequence++;
+
+	int written = snprintf(slot->path, sizeof(slot->path), "%s_%dx%d_%u_%u.%s", state->current_scene, state->backbuffer_width, state->backbuffer_height,
+												 sample_count, sequence, ExportFormatNames[state->export_format]);
+	if (written < 0 || written >= (int)sizeof(slot->path))
+	{
+		fprintf(stderr, "ERROR: failed to create path to exported image.\n");
+		return false;
+	}
+
+	u64 size = sizeof(float)*4*(u64)state->backbuffer_width*state->backbuffer_height;
+	if (slot->capacity < size)
+	{
+		GLbitfield flags = GL_MAP_READ_BIT|GL_MAP_PERSISTENT_BIT|GL_MAP_COHERENT_BIT;
+
+		if (slot->pbo != 0) glDeleteBuffers(1, &slot->pbo);
+		glGenBuffers(1, &slot->pbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+		glBufferStorage(GL_PIXEL_PACK_BUFFER, size, 0, flags|GL_CLIENT_STORAGE_BIT);
+		slot->pixels   = (float*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, flags);
+		slot->capacity = size;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		if (slot->pixels == 0)
+		{
+			fprintf(stderr, "ERROR: failed to map pixel buffer, dropped export of sample %u.\n", sample_count);
+
+			glDeleteBuffers(1, &slot->pbo);
+			slot->pbo      = 0;
+			slot->capacity = 0;
+
+			SDL_LockMutex(exporter->mutex);
+			exporter->dropped_count += 1;
+			SDL_UnlockMutex(exporter->mutex);
 
+			return false;
+		}
+	}
+
+	slot->width    = state->backbuffer_width;
+	slot->height   = state->backbuffer_height;
+	slot->format   = state->export_format;
+	slot->sequence = sequence;
+
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+	glGetTextureImage(state->backbuffer_texture, 0, GL_RGBA, GL_FLOAT, (GLsizei)size, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	SDL_LockMutex(exporter->mutex);
+	slot->state = ExportSlot_Reading;
+	SDL_UnlockMutex(exporter->mutex);
+
+	return true;
+}
+
+// NOTE: Loads the first scene from benchmark_scene_index on that loads successfully, scenes that fail are reported and
+//       skipped. Stops the benchmark, restoring the dispersion setting it overrode, and returns false when no scene is
+//       left.
+bool
+LoadNextBenchmarkScene(State* state)
+{
+	for (; state->benchmark_scene_index < ARRAY_SIZE(SceneNames); ++state->benchmark_scene_index)
+	{
+		state->current_scene = SceneNames[state->benchmark_scene_index];
+		if (LoadScene(state, state->current_scene))
+		{
+			state->should_regen_buffers = true;
 			return true;
 		}
+
+		printf("%-55s %12s\n", state->current_scene, "failed to load");
+		fflush(stdout);
 	}
+
+	state->is_benchmarking      = false;
+	state->enable_dispersion    = state->benchmark_restore_dispersion;
+	state->should_regen_buffers = true;
+	return false;
+}
+
+bool
+StartBenchmark(State* state)
+{
+	if (state->benchmark_samples < 2) state->benchmark_samples = 2;
+
+	// NOTE: dispersion masks all but one channel per frame, which the variance estimate doesn't account for
+	state->benchmark_restore_dispersion = state->enable_dispersion;
+	state->enable_dispersion            = false;
+	state->is_benchmarking              = true;
+	state->benchmark_scene_index        = 0;
+
+	printf("benchmark: %d samples at %dx%d, %d bounces, russian roulette depth %d\n", state->benchmark_samples, state->backbuffer_width,
+				 state->backbuffer_height, state->number_of_bounces, state->russian_roulette_depth);
+	printf("%-55s %12s %14s %14s\n", "scene", "trace ms", "variance", "variance*s");
+
+	return LoadNextBenchmarkScene(state);
+}
+
+// NOTE: Reports the variance of the pixel means, estimated from the accumulated luminance and squared luminance, and
+//       the total path tracing time of the current scene. Their product is the inverse efficiency of the estimator,
+//       lower is better. Moves on to the next scene, returns false once every scene has been measured.
+bool
+AdvanceBenchmark(State* state)
+{
+	int width  = state->backbuffer_width;
+	int height = state->backbuffer_height;
+	double n   = (double)state->benchmark_samples;
+
+	u64 size      = sizeof(float)*4*(u64)width*height;
+	float* pixels = (float*)malloc(size);
+	DEFER(free(pixels));
+
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+	glGetTextureImage(state->accumulated_frames_texture, 0, GL_RGBA, GL_FLOAT, (GLsizei)size, pixels);
+
+	double variance = 0;
+	for (u64 i = 0; i < (u64)width*height; ++i)
+	{
+		float* p = pixels + 4*i;
+
+		double mean      = (0.2126*p[0] + 0.7152*p[1] + 0.0722*p[2])/n;
+		double mean_sq   = p[3]/n;
+		double pixel_var = (mean_sq - mean*mean)*n/(n - 1);
+		if (pixel_var > 0) variance += pixel_var/n;
+	}
+	variance /= (double)width*height;
+
+	printf("%-55s %12.2f %14.6g %14.6g\n", state->current_scene, state->benchmark_trace_time, variance, variance*state->benchmark_trace_time/1000);
+	fflush(stdout);
+
+	state->benchmark_scene_index += 1;
+	return LoadNextBenchmarkScene(state);
 }
 
 int
 main(int argc, char** argv)
 {
-    (void)argc;
-    (void)argv;
-    
     DEFER(SDL_Quit());
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER) != 0) fprintf(stderr, "ERROR: failed to initialize sdl2. %s\n", SDL_GetError());
     else
@@ -382,10 +1027,50 @@ main(int argc, char** argv)
                 state.current_resolution_index = 5;
 								state.current_scene            = SceneNames[0];
 								state.number_of_bounces        = 4;
+								state.russian_roulette_depth   = 3;
 								state.enable_dispersion        = false;
+								state.geometry_budget_kb       = 256*1024;
+								state.export_format            = ExportFormat_PNG;
+								state.export_interval          = 0;
+								state.benchmark_samples        = 64;
                 state.backbuffer_width         = Resolutions[state.current_resolution_index][0];
                 state.backbuffer_height        = Resolutions[state.current_resolution_index][1];
                 state.should_regen_buffers     = true;
+                DEFER(UnloadScenePages(&state));
+                DEFER(StopImageExporter(&state.exporter));
+
+								/// Command line
+								bool run_benchmark = false;
+								for (int i = 1; i < argc; ++i)
+								{
+									if      (strcmp(argv[i], "--benchmark") == 0)                              run_benchmark                = true;
+									else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc)                state.benchmark_samples      = atoi(argv[++i]);
+									else if (strcmp(argv[i], "--bounces") == 0 && i + 1 < argc)                state.number_of_bounces      = atoi(argv[++i]);
+									else if (strcmp(argv[i], "--russian-roulette-depth") == 0 && i + 1 < argc) state.russian_roulette_depth = atoi(argv[++i]);
+									else if (strcmp(argv[i], "--export-interval") == 0 && i + 1 < argc)        state.export_interval        = atoi(argv[++i]);
+									else if (strcmp(argv[i], "--export-format") == 0 && i + 1 < argc)
+									{
+										char* format_name = argv[++i];
+
+										bool found_format = false;
+										for (u32 j = 0; j < ARRAY_SIZE(ExportFormatNames); ++j)
+										{
+											if (strcmp(format_name, ExportFormatNames[j]) == 0)
+											{
+												state.export_format = j;
+												found_format        = true;
+											}
+										}
+
+										if (!found_format) fprintf(stderr, "WARNING: ignoring unknown export format %s\n", format_name);
+									}
+									else fprintf(stderr, "WARNING: ignoring unknown argument %s\n", argv[i]);
+								}
+
+								if (state.number_of_bounces < 1)                     state.number_of_bounces      = 1;
+								if (state.number_of_bounces > MAX_NUMBER_OF_BOUNCES) state.number_of_bounces      = MAX_NUMBER_OF_BOUNCES;
+								if (state.russian_roulette_depth < 0)                state.russian_roulette_depth = 0;
+								if (state.export_interval < 0)                       state.export_interval        = 0;
                 
                 /// Program setup
                 bool setup_failed = false;
@@ -462,6 +1147,12 @@ main(int argc, char** argv)
 										/// Load scene
 										setup_failed = (setup_failed || !LoadScene(&state, state.current_scene));
 
+										/// Create timer query for measuring path tracing time
+										glGenQueries(1, &state.trace_time_query);
+
+										/// Start background image writer
+										setup_failed = (setup_failed || !StartImageExporter(&state.exporter));
+
                     /// Create compute program for rendering to the backbuffer
                     state.compute_program = glCreateProgram();
                     {
@@ -566,6 +1257,7 @@ main(int argc, char** argv)
                 if (!setup_failed)
                 {
                     bool done = false;
+										if (run_benchmark && !StartBenchmark(&state)) done = true;
                     while (!done)
                     {
                         SDL_Event event;
@@ -593,10 +1285,7 @@ main(int argc, char** argv)
                             {
                                 if (ImGui::Selectable(SceneNames[i], SceneNames[i] == state.current_scene))
                                 {
-                                    state.current_scene = SceneNames[i];
-																		LoadScene(&state, state.current_scene);
-                                    
-                                    state.should_regen_buffers = true;
+																		SwitchScene(&state, SceneNames[i]);
                                 }
                                 
                                 if (SceneNames[i] == state.current_scene)
@@ -630,7 +1319,12 @@ main(int argc, char** argv)
                             ImGui::EndCombo();
                         }
                         
-												if (ImGui::SliderInt("Number of bounces", &state.number_of_bounces, 1, 15))
+												if (ImGui::SliderInt("Number of bounces", &state.number_of_bounces, 1, MAX_NUMBER_OF_BOUNCES))
+												{
+													state.should_regen_buffers = true;
+												}
+
+												if (ImGui::SliderInt("Russian roulette depth (0 = off)", &state.russian_roulette_depth, 0, MAX_NUMBER_OF_BOUNCES))
 												{
 													state.should_regen_buffers = true;
 												}
@@ -640,7 +1334,53 @@ main(int argc, char** argv)
 													state.should_regen_buffers = true;
 												}
 
+												ImGui::SliderInt("Geometry budget (KB)", &state.geometry_budget_kb, 32, 4*1024*1024, "%d", ImGuiSliderFlags_Logarithmic);
+												if (ImGui::IsItemDeactivatedAfterEdit()) SwitchScene(&state, state.current_scene);
+
+												ImGui::Text("resident pages: %u/%u (%u slots)", state.pager.resident_count, state.pager.page_count, state.pager.slot_count);
+												ImGui::Text("missing pages: %u", state.pager.missing_count);
+												if (state.pager.is_overcommitted) ImGui::Text("working set exceeds the budget, keeping the most hit pages resident");
+
+												if (ImGui::BeginCombo("Export format", ExportFormatNames[state.export_format]))
+												{
+													for (u32 i = 0; i < ARRAY_SIZE(ExportFormatNames); ++i)
+													{
+														if (ImGui::Selectable(ExportFormatNames[i], i == state.export_format)) state.export_format = i;
+														if (i == state.export_format) ImGui::SetItemDefaultFocus();
+													}
+
+													ImGui::EndCombo();
+												}
+
+												if (ImGui::InputInt("Export every N samples (0 = off)", &state.export_interval) && state.export_interval < 0)
+												{
+													state.export_interval = 0;
+												}
+
+												if (ImGui::Button("Save screenshot")) state.should_take_screenshot = true;
+
+												if (state.exporter.mutex != 0)
+												{
+													SDL_LockMutex(state.exporter.mutex);
+													u32 written_count = state.exporter.written_count;
+													u32 dropped_count = state.exporter.dropped_count;
+													SDL_UnlockMutex(state.exporter.mutex);
+
+													ImGui::Text("exported images: %u (%u dropped)", written_count, dropped_count);
+												}
+
+												if (state.is_benchmarking)
+												{
+													ImGui::Text("benchmarking %s (%u/%d)", state.current_scene, state.frame_index, state.benchmark_samples);
+												}
+												else
+												{
+													ImGui::InputInt("Benchmark samples", &state.benchmark_samples);
+													if (ImGui::Button("Run benchmark")) StartBenchmark(&state);
+												}
+
                         ImGui::Text("last render time: %.2f ms", state.last_render_time);
+                        ImGui::Text("last trace time: %.2f ms", state.last_trace_time);
                         ImGui::End();
                         
                         glViewport(0, 0, window_width, window_height);
@@ -663,6 +1403,7 @@ main(int argc, char** argv)
 
                             state.should_regen_buffers = false;
                             state.frame_index          = 0;
+                            state.benchmark_trace_time = 0;
                         }
                         
                         glUseProgram(state.compute_program);
@@ -672,13 +1413,28 @@ main(int argc, char** argv)
                         glUniform2f(1, (float)state.backbuffer_width, (float)state.backbuffer_height);
 												glUniform1ui(2, (unsigned int)state.number_of_bounces);
 												glUniform1ui(3, state.enable_dispersion);
+												glUniform1ui(4, (unsigned int)state.russian_roulette_depth);
                         
                         GLuint num_work_groups_x = state.backbuffer_width/16  + (state.backbuffer_width%16 != 0);
                         GLuint num_work_groups_y = state.backbuffer_height/16 + (state.backbuffer_height%16 != 0);
                         ASSERT(num_work_groups_x <= 65535 && num_work_groups_y <= 65535);
+                        glBeginQuery(GL_TIME_ELAPSED, state.trace_time_query);
                         glDispatchCompute(num_work_groups_x, num_work_groups_y, 1);
+                        glEndQuery(GL_TIME_ELAPSED);
                         
                         glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+												{ /// Export the backbuffer once every channel has received the same number of samples
+													bool completes_sample = (!state.enable_dispersion || state.frame_index%3 == 2);
+													u32 sample_count      = (state.enable_dispersion ? state.frame_index/3 : state.frame_index) + 1;
+
+													bool is_periodic_export = (state.export_interval > 0 && sample_count%state.export_interval == 0);
+													if (completes_sample && (state.should_take_screenshot || is_periodic_export))
+													{
+														RequestImageExport(&state, sample_count);
+														state.should_take_screenshot = false;
+													}
+												}
                         
                         glBindVertexArray(state.display_vao);
                         glActiveTexture(GL_TEXTURE0);
@@ -693,6 +1449,22 @@ main(int argc, char** argv)
                         u64 current_timestamp = GetTicks();
                         state.last_render_time = DiffTicksInMs(state.last_render_timestamp, current_timestamp);
                         state.last_render_timestamp = current_timestamp;
+
+												GLuint64 trace_time_ns;
+												glGetQueryObjectui64v(state.trace_time_query, GL_QUERY_RESULT, &trace_time_ns);
+												state.last_trace_time = (float)trace_time_ns/1000000;
+
+												if (state.is_benchmarking)
+												{
+													state.benchmark_trace_time += state.last_trace_time;
+													if (state.frame_index + 1 == (u32)state.benchmark_samples && !AdvanceBenchmark(&state) && run_benchmark)
+													{
+														done = true;
+													}
+												}
+
+												if (UpdateScenePages(&state)) state.should_regen_buffers = true;
+												UpdateImageExports(&state.exporter, false);
                         
                         state.frame_index += 1;
                         
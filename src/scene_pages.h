@@ -0,0 +1,872 @@
+#pragma once
+
+#include "common.h"
+
+struct Triangle_Data
+{
+	float p0p2x[4];
+	float p1p2y[4];
+	float p2z[4];
+};
+
+struct Triangle_Material_Data
+{
+	float n0n2x[4];
+	float n1n2y[4];
+	float n2zmat[4];
+};
+
+struct Bounding_Sphere
+{
+	float pr[4];
+};
+
+struct Material
+{
+	float color[4];
+	u32 kind;
+	u32 _pad_0[3];
+};
+
+struct Light
+{
+  float p0nx[4];
+  float p1ny[4];
+  float p2nz[4];
+  float areaidmat[4];
+};
+
+/*   0 - 3   *   4 - 7    *   8 - 11     *   12 - 15      *
+ *-------------------------------------------------------*
+ * magic     * version    * page tri     * page data size *
+ *           *            * count        *                *
+ *-------------------------------------------------------*
+ * page_count * mat_count * light_count  *                *
+ *-------------------------------------------------------*
+ * page table                                            *
+ * pr:     p.x   p.y   p.z   r                           *
+ * count:  tri_count  slot  (slot is -1 on disk)         *
+ *-------------------------------------------------------*
+ * materials                                             *
+ *-------------------------------------------------------*
+ * lights (id is page*SCENE_PAGE_TRIANGLE_COUNT +        *
+ *         index of the triangle within the page, stored *
+ *         as the bits of an u32)                        *
+ *-------------------------------------------------------*
+ * pages, each SCENE_PAGE_TRIANGLE_COUNT wide            *
+ * triangle intersection data                            *
+ * triangle material data                                *
+ * bounding spheres                                      *
+ *-------------------------------------------------------*
+ */
+
+// NOTE: must match SCENE_PAGE_TRIANGLE_COUNT in compute_shader.comp
+#define SCENE_PAGE_TRIANGLE_COUNT 256
+#define SCENE_PAGE_STAGING_COUNT  8
+#define SCENE_PAGE_FILE_MAGIC     0x4E435350
+#define SCENE_PAGE_FILE_VERSION   3
+
+// NOTE: Converting a scene reads it sequentially SCENE_CONVERSION_CHUNK_COUNT triangles at a time and sorts the
+//       triangles into buckets of SCENE_CONVERSION_BUCKET_PAGE_COUNT consecutive pages in a temporary file, buffering
+//       SCENE_CONVERSION_BUCKET_BUFFER_COUNT triangles per bucket. Each bucket is then assembled in memory and written
+//       out as a whole, so both the scene and the paged file are only ever accessed in large sequential runs.
+#define SCENE_CONVERSION_CHUNK_COUNT         4096
+#define SCENE_CONVERSION_BUCKET_PAGE_COUNT   1024
+#define SCENE_CONVERSION_BUCKET_BUFFER_COUNT 64
+
+// NOTE: Traversal reports, per page, how many rays entered its bounds in a frame. The counts are folded into a heat
+//       that decays by SCENE_PAGE_HEAT_DECAY every tick. When every slot holds a page that was hit in the current tick,
+//       a missing page only replaces the coldest of them when it is hotter by SCENE_PAGE_SWAP_MARGIN, which keeps the
+//       resident set from flipping between pages of about the same heat.
+#define SCENE_PAGE_HEAT_DECAY  0.75f
+#define SCENE_PAGE_SWAP_MARGIN 1.5f
+
+#define PageStaging_Free      0
+#define PageStaging_Requested 1
+#define PageStaging_Loaded    2
+
+struct Scene_Page_File_Header
+{
+	u32 magic;
+	u32 version;
+	u32 page_triangle_count;
+	u32 page_data_size;
+	u32 page_count;
+	u32 mat_count;
+	u32 light_count;
+	u32 _pad_0;
+};
+
+struct Scene_Page
+{
+	float pr[4];
+	u32 tri_count;
+	i32 slot;
+	u32 _pad_0[2];
+};
+
+struct Scene_Page_Data
+{
+	Triangle_Data tri_data[SCENE_PAGE_TRIANGLE_COUNT];
+	Triangle_Material_Data tri_mat_data[SCENE_PAGE_TRIANGLE_COUNT];
+	Bounding_Sphere bounding_spheres[SCENE_PAGE_TRIANGLE_COUNT];
+};
+
+struct Scene_Conversion_Record
+{
+	u32 id;
+	Triangle_Data tri_data;
+	Triangle_Material_Data tri_mat_data;
+	Bounding_Sphere bounding_sphere;
+};
+
+struct Scene_Page_Staging
+{
+	u32 page;
+	u32 state;
+	Scene_Page_Data* data;
+};
+
+// NOTE: Bookkeeping for which pages of a paged scene are resident in which slot. This is deliberately free of any
+//       graphics or threading code, the caller owns the gpu buffers and decides how pages are read and uploaded.
+struct Scene_Pager
+{
+	FILE* file;
+	u64 page_data_offset;
+	Scene_Page_Staging staging[SCENE_PAGE_STAGING_COUNT];
+
+	u32 page_count;
+	u32 slot_count;
+	Scene_Page* pages;
+	u32* page_last_used;
+	u32* page_feedback;
+	float* page_heat;
+	i32* slot_pages;
+
+	u32 mat_count;
+	u32 light_count;
+	Material* materials;
+	Light* lights;
+
+	u32 tick;
+	u32 resident_count;
+	u32 missing_count;
+
+	// NOTE: set while the pages rays hit don't all fit in the budget, only hotter pages are swapped in then
+	bool is_overcommitted;
+};
+
+// NOTE: .scene files store the id of a light's triangle as a float, paged scenes store the bits of an u32 instead since
+//       floats can't represent every id past 2^24 triangles. The shader reads it back with floatBitsToInt.
+u32
+GetLightTriangleId(Light* light)
+{
+	u32 id;
+	memcpy(&id, &light->areaidmat[1], sizeof(id));
+	return id;
+}
+
+void
+SetLightTriangleId(Light* light, u32 id)
+{
+	memcpy(&light->areaidmat[1], &id, sizeof(id));
+}
+
+typedef void Upload_Scene_Page_Proc(void* user_data, u32 page, i32 slot, i32 evicted_page, Scene_Page_Data* data);
+
+bool
+ReadFileAt(FILE* file, u64 offset, void* dst, u64 size)
+{
+	return (SeekFile(file, offset) && (size == 0 || fread(dst, size, 1, file) == 1));
+}
+
+bool
+WriteFileAt(FILE* file, u64 offset, void* src, u64 size)
+{
+	return (SeekFile(file, offset) && (size == 0 || fwrite(src, size, 1, file) == 1));
+}
+
+struct Morton_Index
+{
+	u32 code;
+	u32 index;
+};
+
+int
+CompareMortonIndices(const void* a, const void* b)
+{
+	u32 code_a = ((Morton_Index*)a)->code;
+	u32 code_b = ((Morton_Index*)b)->code;
+	return (code_a < code_b ? -1 : (code_a > code_b ? 1 : 0));
+}
+
+u32
+SpreadBits10(u32 x)
+{
+	x &= 0x3FF;
+	x = (x | (x << 16)) & 0x030000FF;
+	x = (x | (x <<  8)) & 0x0300F00F;
+	x = (x | (x <<  4)) & 0x030C30C3;
+	x = (x | (x <<  2)) & 0x09249249;
+	return x;
+}
+
+bool
+IsPageFileHeaderCurrent(Scene_Page_File_Header* header)
+{
+	return (header->magic               == SCENE_PAGE_FILE_MAGIC     &&
+					header->version             == SCENE_PAGE_FILE_VERSION   &&
+					header->page_triangle_count == SCENE_PAGE_TRIANGLE_COUNT &&
+					header->page_data_size      == sizeof(Scene_Page_Data));
+}
+
+// NOTE: Converts a flat .scene file into the paged format described above. Triangles are sorted along a morton curve
+//       through their bounding sphere centers and cut into fixed size pages, so each page is a spatially compact cluster
+//       that can be culled (and streamed) as a whole. The scene is streamed in two passes, the first only reads the
+//       bounding spheres to build the order, the second copies the triangles through the bucket file next to the
+//       paged file, so only the order, the page table and one bucket need to fit in memory.
+bool
+ConvertSceneToPages(char* scene_path, char* paged_path)
+{
+	FILE* scene_file = fopen(scene_path, "rb");
+	DEFER(if (scene_file != 0) fclose(scene_file));
+
+	if (scene_file == 0)
+	{
+		fprintf(stderr, "ERROR: failed to open scene file.\n");
+		return false;
+	}
+
+	u64 scene_file_size = GetFileSize(scene_file);
+
+	u32 counts[3];
+	if (fread(counts, sizeof(counts), 1, scene_file) != 1)
+	{
+		fprintf(stderr, "ERROR: failed to read scene file.\n");
+		return false;
+	}
+
+	u32 tri_count   = counts[0];
+	u32 mat_count   = counts[1];
+	u32 light_count = counts[2];
+
+	u64 tri_data_offset        = sizeof(counts);
+	u64 tri_mat_data_offset    = tri_data_offset        + sizeof(Triangle_Data)*(u64)tri_count;
+	u64 bounding_sphere_offset = tri_mat_data_offset    + sizeof(Triangle_Material_Data)*(u64)tri_count;
+	u64 material_offset        = bounding_sphere_offset + sizeof(Bounding_Sphere)*(u64)tri_count;
+	u64 light_offset           = material_offset        + sizeof(Material)*(u64)mat_count;
+
+	if (light_offset + sizeof(Light)*(u64)light_count > scene_file_size)
+	{
+		fprintf(stderr, "ERROR: scene file is truncated.\n");
+		return false;
+	}
+
+	Material* materials = (Material*)malloc(sizeof(Material)*mat_count);
+	DEFER(free(materials));
+
+	Light* lights = (Light*)malloc(sizeof(Light)*light_count);
+	DEFER(free(lights));
+
+	if (!ReadFileAt(scene_file, material_offset, materials, sizeof(Material)*(u64)mat_count) ||
+			!ReadFileAt(scene_file, light_offset, lights, sizeof(Light)*(u64)light_count))
+	{
+		fprintf(stderr, "ERROR: failed to read scene file.\n");
+		return false;
+	}
+
+	u32 page_count = tri_count/SCENE_PAGE_TRIANGLE_COUNT + (tri_count%SCENE_PAGE_TRIANGLE_COUNT != 0);
+
+	Morton_Index* order = (Morton_Index*)malloc(sizeof(Morton_Index)*tri_count);
+	DEFER(free(order));
+
+	u32* new_ids = (u32*)malloc(sizeof(u32)*tri_count);
+	DEFER(free(new_ids));
+
+	Bounding_Sphere* chunk = (Bounding_Sphere*)malloc(sizeof(Bounding_Sphere)*SCENE_CONVERSION_CHUNK_COUNT);
+	DEFER(free(chunk));
+
+	/// Pass 1: build the morton order from the bounding sphere centers
+	{
+		float min[3] = { 1e30f,  1e30f,  1e30f};
+		float max[3] = {-1e30f, -1e30f, -1e30f};
+
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			for (u32 first = 0; first < tri_count; first += SCENE_CONVERSION_CHUNK_COUNT)
+			{
+				u32 count = tri_count - first;
+				if (count > SCENE_CONVERSION_CHUNK_COUNT) count = SCENE_CONVERSION_CHUNK_COUNT;
+
+				if (!ReadFileAt(scene_file, bounding_sphere_offset + sizeof(Bounding_Sphere)*(u64)first, chunk, sizeof(Bounding_Sphere)*(u64)count))
+				{
+					fprintf(stderr, "ERROR: failed to read scene file.\n");
+					return false;
+				}
+
+				for (u32 i = 0; i < count; ++i)
+				{
+					if (pass == 0)
+					{
+						for (int j = 0; j < 3; ++j)
+						{
+							float p = chunk[i].pr[j];
+							if (p < min[j]) min[j] = p;
+							if (p > max[j]) max[j] = p;
+						}
+					}
+					else
+					{
+						u32 code = 0;
+						for (int j = 0; j < 3; ++j)
+						{
+							float extent = max[j] - min[j];
+							float t      = (extent > 0 ? (chunk[i].pr[j] - min[j])/extent : 0);
+							code |= SpreadBits10((u32)(t*1023)) << (2 - j);
+						}
+
+						order[first + i].code  = code;
+						order[first + i].index = first + i;
+					}
+				}
+			}
+		}
+
+		qsort(order, tri_count, sizeof(Morton_Index), CompareMortonIndices);
+
+		for (u32 i = 0; i < tri_count; ++i) new_ids[order[i].index] = i;
+	}
+
+	FILE* paged_file = fopen(paged_path, "wb");
+	DEFER(if (paged_file != 0) fclose(paged_file));
+
+	if (paged_file == 0)
+	{
+		fprintf(stderr, "ERROR: failed to create paged scene file.\n");
+		return false;
+	}
+
+	Scene_Page* pages = (Scene_Page*)malloc(sizeof(Scene_Page)*page_count);
+	memset(pages, 0, sizeof(Scene_Page)*page_count);
+	DEFER(free(pages));
+
+	Scene_Page_File_Header header = {};
+	header.magic               = SCENE_PAGE_FILE_MAGIC;
+	header.version             = SCENE_PAGE_FILE_VERSION;
+	header.page_triangle_count = SCENE_PAGE_TRIANGLE_COUNT;
+	header.page_data_size      = sizeof(Scene_Page_Data);
+	header.page_count          = page_count;
+	header.mat_count           = mat_count;
+	header.light_count         = light_count;
+
+	u64 page_data_offset = sizeof(header) + sizeof(Scene_Page)*(u64)page_count + sizeof(Material)*(u64)mat_count + sizeof(Light)*(u64)light_count;
+
+	bool failed = false;
+
+	// NOTE: the page table is written with placeholder bounds first and rewritten once every page has been copied
+	failed = (failed || fwrite(&header, sizeof(header), 1, paged_file) != 1);
+	failed = (failed || fwrite(pages, sizeof(Scene_Page), page_count, paged_file) != page_count);
+	failed = (failed || fwrite(materials, sizeof(Material), mat_count, paged_file) != mat_count);
+
+	for (u32 i = 0; i < light_count && !failed; ++i)
+	{
+		Light light = lights[i];
+
+		float id      = light.areaidmat[1];
+		bool is_valid = (id >= 0 && id < 4294967296.0f && id == floorf(id) && (u32)id < tri_count);
+		if (!is_valid)
+		{
+			fprintf(stderr, "ERROR: light %u refers to triangle %g, which is not in the scene.\n", i, id);
+			failed = true;
+			break;
+		}
+
+		SetLightTriangleId(&light, new_ids[(u32)id]);
+		failed = (fwrite(&light, sizeof(Light), 1, paged_file) != 1);
+	}
+
+	/// Pass 2: sort the triangles into buckets of consecutive pages, reading the scene sequentially
+	u64 bucket_tri_count = (u64)SCENE_CONVERSION_BUCKET_PAGE_COUNT*SCENE_PAGE_TRIANGLE_COUNT;
+	u32 bucket_count     = page_count/SCENE_CONVERSION_BUCKET_PAGE_COUNT + (page_count%SCENE_CONVERSION_BUCKET_PAGE_COUNT != 0);
+
+	char bucket_path[1024] = {};
+	{
+		int written = snprintf(bucket_path, sizeof(bucket_path), "%s.buckets", paged_path);
+		if (written < 0 || written >= (int)sizeof(bucket_path))
+		{
+			fprintf(stderr, "ERROR: failed to create path to scene conversion bucket file.\n");
+			return false;
+		}
+	}
+
+	FILE* bucket_file = fopen(bucket_path, "w+b");
+	DEFER(if (bucket_file != 0) { fclose(bucket_file); remove(bucket_path); });
+
+	if (bucket_file == 0)
+	{
+		fprintf(stderr, "ERROR: failed to create scene conversion bucket file.\n");
+		return false;
+	}
+
+	u64* bucket_written = (u64*)calloc(bucket_count, sizeof(u64));
+	DEFER(free(bucket_written));
+
+	u32* bucket_buffered = (u32*)calloc(bucket_count, sizeof(u32));
+	DEFER(free(bucket_buffered));
+
+	Scene_Conversion_Record* bucket_buffers = (Scene_Conversion_Record*)malloc(sizeof(Scene_Conversion_Record)*SCENE_CONVERSION_BUCKET_BUFFER_COUNT*bucket_count);
+	DEFER(free(bucket_buffers));
+
+	{
+		Triangle_Data* tri_chunk              = (Triangle_Data*)malloc(sizeof(Triangle_Data)*SCENE_CONVERSION_CHUNK_COUNT);
+		Triangle_Material_Data* tri_mat_chunk = (Triangle_Material_Data*)malloc(sizeof(Triangle_Material_Data)*SCENE_CONVERSION_CHUNK_COUNT);
+		DEFER(free(tri_chunk));
+		DEFER(free(tri_mat_chunk));
+
+		for (u32 first = 0; first < tri_count && !failed; first += SCENE_CONVERSION_CHUNK_COUNT)
+		{
+			u32 count = tri_count - first;
+			if (count > SCENE_CONVERSION_CHUNK_COUNT) count = SCENE_CONVERSION_CHUNK_COUNT;
+
+			failed = (!ReadFileAt(scene_file, tri_data_offset        + sizeof(Triangle_Data)*(u64)first,          tri_chunk,     sizeof(Triangle_Data)*(u64)count)          ||
+								!ReadFileAt(scene_file, tri_mat_data_offset    + sizeof(Triangle_Material_Data)*(u64)first, tri_mat_chunk, sizeof(Triangle_Material_Data)*(u64)count) ||
+								!ReadFileAt(scene_file, bounding_sphere_offset + sizeof(Bounding_Sphere)*(u64)first,        chunk,         sizeof(Bounding_Sphere)*(u64)count));
+
+			for (u32 i = 0; i < count && !failed; ++i)
+			{
+				u32 id     = new_ids[first + i];
+				u32 bucket = (u32)(id/bucket_tri_count);
+
+				Scene_Conversion_Record* buffer = bucket_buffers + (u64)bucket*SCENE_CONVERSION_BUCKET_BUFFER_COUNT;
+				Scene_Conversion_Record* record = &buffer[bucket_buffered[bucket]++];
+				record->id              = id;
+				record->tri_data        = tri_chunk[i];
+				record->tri_mat_data    = tri_mat_chunk[i];
+				record->bounding_sphere = chunk[i];
+
+				if (bucket_buffered[bucket] == SCENE_CONVERSION_BUCKET_BUFFER_COUNT)
+				{
+					u64 offset = sizeof(Scene_Conversion_Record)*(bucket*bucket_tri_count + bucket_written[bucket]);
+					failed = !WriteFileAt(bucket_file, offset, buffer, sizeof(Scene_Conversion_Record)*SCENE_CONVERSION_BUCKET_BUFFER_COUNT);
+
+					bucket_written[bucket] += SCENE_CONVERSION_BUCKET_BUFFER_COUNT;
+					bucket_buffered[bucket] = 0;
+				}
+			}
+		}
+
+		for (u32 bucket = 0; bucket < bucket_count && !failed; ++bucket)
+		{
+			u64 offset = sizeof(Scene_Conversion_Record)*(bucket*bucket_tri_count + bucket_written[bucket]);
+			failed = !WriteFileAt(bucket_file, offset, bucket_buffers + (u64)bucket*SCENE_CONVERSION_BUCKET_BUFFER_COUNT, sizeof(Scene_Conversion_Record)*bucket_buffered[bucket]);
+
+			bucket_written[bucket] += bucket_buffered[bucket];
+		}
+	}
+
+	/// Pass 3: assemble the pages of each bucket in memory and write them out in morton order
+	{
+		Scene_Page_Data* bucket_pages = (Scene_Page_Data*)malloc(sizeof(Scene_Page_Data)*SCENE_CONVERSION_BUCKET_PAGE_COUNT);
+		DEFER(free(bucket_pages));
+
+		Scene_Conversion_Record* records = (Scene_Conversion_Record*)malloc(sizeof(Scene_Conversion_Record)*SCENE_CONVERSION_CHUNK_COUNT);
+		DEFER(free(records));
+
+		failed = (failed || !SeekFile(paged_file, page_data_offset));
+
+		for (u32 bucket = 0; bucket < bucket_count && !failed; ++bucket)
+		{
+			u32 first_page        = bucket*SCENE_CONVERSION_BUCKET_PAGE_COUNT;
+			u32 bucket_page_count = page_count - first_page;
+			if (bucket_page_count > SCENE_CONVERSION_BUCKET_PAGE_COUNT) bucket_page_count = SCENE_CONVERSION_BUCKET_PAGE_COUNT;
+
+			memset(bucket_pages, 0, sizeof(Scene_Page_Data)*bucket_page_count);
+
+			for (u64 first = 0; first < bucket_written[bucket] && !failed; first += SCENE_CONVERSION_CHUNK_COUNT)
+			{
+				u64 count = bucket_written[bucket] - first;
+				if (count > SCENE_CONVERSION_CHUNK_COUNT) count = SCENE_CONVERSION_CHUNK_COUNT;
+
+				u64 offset = sizeof(Scene_Conversion_Record)*(bucket*bucket_tri_count + first);
+				failed = !ReadFileAt(bucket_file, offset, records, sizeof(Scene_Conversion_Record)*count);
+
+				for (u64 i = 0; i < count && !failed; ++i)
+				{
+					u32 local_id = (u32)(records[i].id - bucket*bucket_tri_count);
+
+					Scene_Page_Data* data = &bucket_pages[local_id/SCENE_PAGE_TRIANGLE_COUNT];
+					u32 index             = local_id%SCENE_PAGE_TRIANGLE_COUNT;
+					data->tri_data[index]         = records[i].tri_data;
+					data->tri_mat_data[index]     = records[i].tri_mat_data;
+					data->bounding_spheres[index] = records[i].bounding_sphere;
+				}
+			}
+
+			for (u32 bucket_page = 0; bucket_page < bucket_page_count; ++bucket_page)
+			{
+				Scene_Page_Data* page_data = &bucket_pages[bucket_page];
+				u32 page                   = first_page + bucket_page;
+
+				u32 count = tri_count - page*SCENE_PAGE_TRIANGLE_COUNT;
+				if (count > SCENE_PAGE_TRIANGLE_COUNT) count = SCENE_PAGE_TRIANGLE_COUNT;
+
+				float min[3] = { 1e30f,  1e30f,  1e30f};
+				float max[3] = {-1e30f, -1e30f, -1e30f};
+				for (u32 i = 0; i < count; ++i)
+				{
+					Bounding_Sphere* sphere = &page_data->bounding_spheres[i];
+					for (int j = 0; j < 3; ++j)
+					{
+						if (sphere->pr[j] - sphere->pr[3] < min[j]) min[j] = sphere->pr[j] - sphere->pr[3];
+						if (sphere->pr[j] + sphere->pr[3] > max[j]) max[j] = sphere->pr[j] + sphere->pr[3];
+					}
+				}
+
+				float center[3] = {(min[0] + max[0])/2, (min[1] + max[1])/2, (min[2] + max[2])/2};
+				float radius    = 0;
+				for (u32 i = 0; i < count; ++i)
+				{
+					Bounding_Sphere* sphere = &page_data->bounding_spheres[i];
+					float d[3] = {sphere->pr[0] - center[0], sphere->pr[1] - center[1], sphere->pr[2] - center[2]};
+					float r    = sqrtf(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]) + sphere->pr[3];
+					if (r > radius) radius = r;
+				}
+
+				pages[page].pr[0]     = center[0];
+				pages[page].pr[1]     = center[1];
+				pages[page].pr[2]     = center[2];
+				pages[page].pr[3]     = radius;
+				pages[page].tri_count = count;
+				pages[page].slot      = -1;
+			}
+
+			failed = (failed || fwrite(bucket_pages, sizeof(Scene_Page_Data), bucket_page_count, paged_file) != bucket_page_count);
+		}
+	}
+
+	failed = (failed || !SeekFile(paged_file, sizeof(header)));
+	failed = (failed || fwrite(pages, sizeof(Scene_Page), page_count, paged_file) != page_count);
+
+	if (failed)
+	{
+		fprintf(stderr, "ERROR: failed to convert scene to paged scene file.\n");
+		fclose(paged_file);
+		paged_file = 0;
+		remove(paged_path);
+		return false;
+	}
+
+	return true;
+}
+
+void
+CloseScenePages(Scene_Pager* pager)
+{
+	if (pager->file != 0) fclose(pager->file);
+
+	for (int i = 0; i < SCENE_PAGE_STAGING_COUNT; ++i) free(pager->staging[i].data);
+
+	free(pager->pages);
+	free(pager->page_last_used);
+	free(pager->page_feedback);
+	free(pager->page_heat);
+	free(pager->slot_pages);
+	free(pager->materials);
+	free(pager->lights);
+
+	*pager = {};
+}
+
+// NOTE: Opens the paged version of a scene, converting it first when it is missing, stale (older than the scene file)
+//       or written by a different version of the format. paged_paths are the places the paged scene may be cached, in
+//       order of preference. An up to date file in any of them is reused, otherwise the scene is converted into the
+//       first one that can be written, so a read only scene directory falls back to the next location. The page
+//       table, materials and lights are read up front, the pages themselves are left for the caller to read with
+//       ReadScenePage. Slots are sized to fit the budget.
+bool
+OpenScenePages(Scene_Pager* pager, char* scene_path, char** paged_paths, u32 paged_path_count, u64 budget_bytes)
+{
+	CloseScenePages(pager);
+
+	Scene_Page_File_Header header = {};
+
+	FILE* paged_file = 0;
+	for (u32 i = 0; i < paged_path_count && paged_file == 0; ++i)
+	{
+		paged_file      = fopen(paged_paths[i], "rb");
+		bool is_current = (paged_file != 0                                                &&
+											 fread(&header, sizeof(header), 1, paged_file) == 1              &&
+											 IsPageFileHeaderCurrent(&header)                                &&
+											 GetFileModifiedTime(scene_path) <= GetFileModifiedTime(paged_paths[i]));
+
+		if (!is_current && paged_file != 0)
+		{
+			fclose(paged_file);
+			paged_file = 0;
+		}
+	}
+
+	if (paged_file == 0)
+	{
+		char* paged_path = 0;
+		for (u32 i = 0; i < paged_path_count && paged_path == 0; ++i)
+		{
+			FILE* file = fopen(paged_paths[i], "wb");
+			if (file != 0)
+			{
+				fclose(file);
+				paged_path = paged_paths[i];
+			}
+		}
+
+		if (paged_path == 0)
+		{
+			fprintf(stderr, "ERROR: failed to create paged scene file, no cache location is writable.\n");
+			return false;
+		}
+
+		if (!ConvertSceneToPages(scene_path, paged_path))
+		{
+			remove(paged_path);
+			return false;
+		}
+
+		paged_file = fopen(paged_path, "rb");
+		if (paged_file == 0 || fread(&header, sizeof(header), 1, paged_file) != 1 || !IsPageFileHeaderCurrent(&header))
+		{
+			fprintf(stderr, "ERROR: invalid paged scene file.\n");
+			if (paged_file != 0) fclose(paged_file);
+			return false;
+		}
+	}
+
+	// NOTE: the pager owns the file from here on, CloseScenePages closes it
+	pager->file = paged_file;
+
+	pager->page_count     = header.page_count;
+	pager->mat_count      = header.mat_count;
+	pager->light_count    = header.light_count;
+	pager->pages          = (Scene_Page*)malloc(sizeof(Scene_Page)*header.page_count);
+	pager->page_last_used = (u32*)calloc(header.page_count, sizeof(u32));
+	pager->page_feedback  = (u32*)calloc(header.page_count, sizeof(u32));
+	pager->page_heat      = (float*)calloc(header.page_count, sizeof(float));
+	pager->materials      = (Material*)malloc(sizeof(Material)*header.mat_count);
+	pager->lights         = (Light*)malloc(sizeof(Light)*header.light_count);
+
+	if (fread(pager->pages, sizeof(Scene_Page), header.page_count, paged_file) != header.page_count ||
+			fread(pager->materials, sizeof(Material), header.mat_count, paged_file) != header.mat_count  ||
+			fread(pager->lights, sizeof(Light), header.light_count, paged_file) != header.light_count)
+	{
+		fprintf(stderr, "ERROR: failed to read paged scene file.\n");
+		CloseScenePages(pager);
+		return false;
+	}
+
+	pager->page_data_offset = sizeof(header) + sizeof(Scene_Page)*(u64)header.page_count + sizeof(Material)*(u64)header.mat_count + sizeof(Light)*(u64)header.light_count;
+
+	pager->slot_count = (u32)(budget_bytes/sizeof(Scene_Page_Data));
+	if (pager->slot_count < 1)                 pager->slot_count = 1;
+	if (pager->slot_count > header.page_count) pager->slot_count = header.page_count;
+
+	pager->slot_pages = (i32*)malloc(sizeof(i32)*pager->slot_count);
+	for (u32 i = 0; i < pager->slot_count; ++i) pager->slot_pages[i] = -1;
+
+	for (int i = 0; i < SCENE_PAGE_STAGING_COUNT; ++i)
+	{
+		pager->staging[i].state = PageStaging_Free;
+		pager->staging[i].data  = (Scene_Page_Data*)malloc(sizeof(Scene_Page_Data));
+	}
+
+	return true;
+}
+
+bool
+ReadScenePage(Scene_Pager* pager, u32 page, Scene_Page_Data* data)
+{
+	return ReadFileAt(pager->file, pager->page_data_offset + sizeof(Scene_Page_Data)*(u64)page, data, sizeof(Scene_Page_Data));
+}
+
+// NOTE: Starts a new tick. feedback holds the number of rays that entered each page this frame, resident or not.
+void
+ProcessPageFeedback(Scene_Pager* pager, u32* feedback)
+{
+	pager->tick         += 1;
+	pager->missing_count = 0;
+
+	for (u32 page = 0; page < pager->page_count; ++page)
+	{
+		pager->page_heat[page] = pager->page_heat[page]*SCENE_PAGE_HEAT_DECAY + (float)feedback[page];
+
+		if (feedback[page] != 0)
+		{
+			if (pager->pages[page].slot != -1) pager->page_last_used[page] = pager->tick;
+			else                               pager->missing_count += 1;
+		}
+	}
+}
+
+bool
+IsSlotEvictable(Scene_Pager* pager, u32 slot)
+{
+	i32 page = pager->slot_pages[slot];
+	return (page == -1 || pager->page_last_used[page] != pager->tick);
+}
+
+bool
+IsPageStaged(Scene_Pager* pager, u32 page)
+{
+	for (int i = 0; i < SCENE_PAGE_STAGING_COUNT; ++i)
+	{
+		if (pager->staging[i].state != PageStaging_Free && pager->staging[i].page == page) return true;
+	}
+
+	return false;
+}
+
+// NOTE: Returns a free slot if there is one, otherwise the slot of the least recently used page. Pages used in the
+//       current tick are never evicted, -1 is returned when every slot holds one.
+i32
+ChooseEvictionSlot(Scene_Pager* pager)
+{
+	i32 result = -1;
+	for (u32 slot = 0; slot < pager->slot_count; ++slot)
+	{
+		i32 page = pager->slot_pages[slot];
+		if      (page == -1)                                          return (i32)slot;
+		else if (pager->page_last_used[page] == pager->tick)          continue;
+		else if (result == -1 || pager->page_last_used[page] < pager->page_last_used[pager->slot_pages[result]]) result = (i32)slot;
+	}
+
+	return result;
+}
+
+// NOTE: Returns the slot of the coldest resident page, skipping the exclude_count slots in exclude, when page is hotter
+//       than it by the swap margin, otherwise -1. Used once ChooseEvictionSlot has nothing left to give.
+i32
+ChooseSwapSlot(Scene_Pager* pager, u32 page, i32* exclude, u32 exclude_count)
+{
+	i32 result = -1;
+	for (u32 slot = 0; slot < pager->slot_count; ++slot)
+	{
+		i32 resident = pager->slot_pages[slot];
+		if (resident == -1) continue;
+
+		bool is_excluded = false;
+		for (u32 i = 0; i < exclude_count; ++i) is_excluded = (is_excluded || exclude[i] == (i32)slot);
+		if (is_excluded) continue;
+
+		if (result == -1 || pager->page_heat[resident] < pager->page_heat[pager->slot_pages[result]]) result = (i32)slot;
+	}
+
+	if (result != -1 && pager->page_heat[pager->slot_pages[result]]*SCENE_PAGE_SWAP_MARGIN >= pager->page_heat[page]) result = -1;
+
+	return result;
+}
+
+// NOTE: Places a page in a slot, returning the page that was evicted from it or -1
+i32
+AssignPageToSlot(Scene_Pager* pager, u32 page, i32 slot)
+{
+	i32 evicted_page = pager->slot_pages[slot];
+	if (evicted_page != -1)
+	{
+		pager->pages[evicted_page].slot = -1;
+		pager->resident_count          -= 1;
+	}
+
+	pager->slot_pages[slot]     = (i32)page;
+	pager->pages[page].slot     = slot;
+	pager->page_last_used[page] = pager->tick;
+	pager->resident_count      += 1;
+
+	return evicted_page;
+}
+
+// NOTE: Moves pages the loader has finished reading into slots, calling upload for each. A loaded page goes to an
+//       evictable slot, or replaces a colder page that was hit this tick, and is dropped when neither exists. Traversal
+//       requests it again if it still needs it. Returns true when the set of resident pages changed. The caller must
+//       hold whatever lock guards the staging entries.
+bool
+MakeLoadedPagesResident(Scene_Pager* pager, Upload_Scene_Page_Proc* upload, void* user_data)
+{
+	bool residency_changed = false;
+	for (int i = 0; i < SCENE_PAGE_STAGING_COUNT; ++i)
+	{
+		Scene_Page_Staging* staging = &pager->staging[i];
+		if (staging->state != PageStaging_Loaded) continue;
+
+		i32 slot = ChooseEvictionSlot(pager);
+		if (slot == -1) slot = ChooseSwapSlot(pager, staging->page, 0, 0);
+
+		if (slot != -1)
+		{
+			i32 evicted_page = AssignPageToSlot(pager, staging->page, slot);
+			upload(user_data, staging->page, slot, evicted_page, staging->data);
+			residency_changed = true;
+		}
+
+		staging->state = PageStaging_Free;
+	}
+
+	return residency_changed;
+}
+
+// NOTE: Hands the hottest pages traversal hit but found missing to the loader. Pages are requested for evictable slots
+//       first, never more than there are of them, and after that only when they would replace a colder resident page.
+//       This way a working set that doesn't fit the budget converges to its most hit pages instead of thrashing.
+//       Returns true when new pages were requested. The caller must hold whatever lock guards the staging entries.
+bool
+RequestMissingPages(Scene_Pager* pager, u32* feedback)
+{
+	u32 pending = 0;
+	for (int i = 0; i < SCENE_PAGE_STAGING_COUNT; ++i) pending += (pager->staging[i].state != PageStaging_Free);
+
+	u32 evictable = 0;
+	for (u32 slot = 0; slot < pager->slot_count; ++slot) evictable += IsSlotEvictable(pager, slot);
+
+	u32 available = (evictable > pending ? evictable - pending : 0);
+
+	// NOTE: counted again, pages made resident since ProcessPageFeedback are no longer missing
+	pager->missing_count = 0;
+	for (u32 page = 0; page < pager->page_count; ++page) pager->missing_count += (feedback[page] != 0 && pager->pages[page].slot == -1);
+
+	pager->is_overcommitted = (pager->missing_count > evictable);
+
+	i32 swap_slots[SCENE_PAGE_STAGING_COUNT];
+	u32 swap_count = 0;
+
+	bool requested_pages = false;
+	for (int i = 0; i < SCENE_PAGE_STAGING_COUNT; ++i)
+	{
+		Scene_Page_Staging* staging = &pager->staging[i];
+		if (staging->state != PageStaging_Free) continue;
+
+		i32 hottest = -1;
+		for (u32 page = 0; page < pager->page_count; ++page)
+		{
+			if (feedback[page] == 0 || pager->pages[page].slot != -1)                continue;
+			if (hottest != -1 && pager->page_heat[page] <= pager->page_heat[hottest]) continue;
+			if (IsPageStaged(pager, page))                                           continue;
+
+			hottest = (i32)page;
+		}
+
+		if (hottest == -1) break;
+
+		if (available != 0) available -= 1;
+		else
+		{
+			// NOTE: the remaining missing pages are all colder than this one, so none of them would be swapped in either
+			i32 slot = ChooseSwapSlot(pager, (u32)hottest, swap_slots, swap_count);
+			if (slot == -1) break;
+
+			swap_slots[swap_count++] = slot;
+		}
+
+		staging->page   = (u32)hottest;
+		staging->state  = PageStaging_Requested;
+		requested_pages = true;
+	}
+
+	return requested_pages;
+}
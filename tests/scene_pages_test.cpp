@@ -0,0 +1,293 @@
+#include "scene_pages.h"
+
+// NOTE: Pages a scene through a budget much smaller than the scene, with the gpu and the loader thread replaced by
+//       synchronous stand-ins, and checks residency, eviction order and that requested pages eventually load.
+//       usage: scene_pages_test <scene file> <paged scene file to write>
+
+int failure_count = 0;
+
+#define CHECK(EX) ((EX) ? 1 : (fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #EX), failure_count += 1, 0))
+
+struct Upload_Log
+{
+	Scene_Pager* pager;
+	u32 upload_count;
+};
+
+void
+RecordUpload(void* user_data, u32 page, i32 slot, i32 evicted_page, Scene_Page_Data* data)
+{
+	Upload_Log* log    = (Upload_Log*)user_data;
+	Scene_Pager* pager = log->pager;
+
+	CHECK(pager->pages[page].slot == slot);
+	CHECK(pager->slot_pages[slot] == (i32)page);
+	CHECK(evicted_page == -1 || pager->pages[evicted_page].slot == -1);
+	CHECK(evicted_page == -1 || pager->page_last_used[evicted_page] != pager->tick ||
+				pager->page_heat[evicted_page]*SCENE_PAGE_SWAP_MARGIN < pager->page_heat[page]);
+
+	// NOTE: the data handed over must be the page that was requested
+	Scene_Page_Data* expected = (Scene_Page_Data*)malloc(sizeof(Scene_Page_Data));
+	CHECK(ReadScenePage(pager, page, expected));
+	CHECK(memcmp(expected, data, sizeof(Scene_Page_Data)) == 0);
+	free(expected);
+
+	log->upload_count += 1;
+}
+
+// NOTE: stands in for the loader thread
+void
+LoadRequestedPages(Scene_Pager* pager)
+{
+	for (int i = 0; i < SCENE_PAGE_STAGING_COUNT; ++i)
+	{
+		Scene_Page_Staging* staging = &pager->staging[i];
+		if (staging->state == PageStaging_Requested)
+		{
+			CHECK(ReadScenePage(pager, staging->page, staging->data));
+			staging->state = PageStaging_Loaded;
+		}
+	}
+}
+
+void
+CheckResidency(Scene_Pager* pager)
+{
+	u32 resident_count = 0;
+	for (u32 slot = 0; slot < pager->slot_count; ++slot)
+	{
+		i32 page = pager->slot_pages[slot];
+		if (page != -1)
+		{
+			resident_count += 1;
+			CHECK(pager->pages[page].slot == (i32)slot);
+		}
+	}
+
+	for (u32 page = 0; page < pager->page_count; ++page)
+	{
+		i32 slot = pager->pages[page].slot;
+		CHECK(slot == -1 || pager->slot_pages[slot] == (i32)page);
+	}
+
+	CHECK(resident_count == pager->resident_count);
+	CHECK(resident_count <= pager->slot_count);
+}
+
+// NOTE: one frame, traversal enters the pages in the working set, each hits[i] times, whether they are resident or not
+void
+SimulateFrame(Scene_Pager* pager, u32* working_set, u32* hits, u32 working_set_count, Upload_Log* log)
+{
+	memset(pager->page_feedback, 0, sizeof(u32)*pager->page_count);
+	for (u32 i = 0; i < working_set_count; ++i) pager->page_feedback[working_set[i]] = hits[i];
+
+	ProcessPageFeedback(pager, pager->page_feedback);
+	MakeLoadedPagesResident(pager, RecordUpload, log);
+	RequestMissingPages(pager, pager->page_feedback);
+	LoadRequestedPages(pager);
+
+	CheckResidency(pager);
+}
+
+bool
+ReadPagedFileHeader(char* path, Scene_Page_File_Header* header)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == 0) return false;
+
+	bool result = (fread(header, sizeof(*header), 1, file) == 1);
+	fclose(file);
+
+	return result;
+}
+
+bool
+WritePagedFileHeader(char* path, Scene_Page_File_Header* header)
+{
+	FILE* file = fopen(path, "r+b");
+	if (file == 0) return false;
+
+	bool result = (fwrite(header, sizeof(*header), 1, file) == 1);
+	result = (fclose(file) == 0 && result);
+
+	return result;
+}
+
+bool
+IsResident(Scene_Pager* pager, u32* pages, u32 count)
+{
+	bool result = true;
+	for (u32 i = 0; i < count; ++i) result = (result && pager->pages[pages[i]].slot != -1);
+	return result;
+}
+
+int
+main(int argc, char** argv)
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "usage: scene_pages_test <scene file> <paged scene file>\n");
+		return 1;
+	}
+
+	remove(argv[2]);
+
+	// NOTE: the first cache location is in a directory that doesn't exist, so like a read only scene directory it can't
+	//       be written and the scene has to be converted into the second one
+	char unwritable_path[1024] = {};
+	snprintf(unwritable_path, sizeof(unwritable_path), "%s.missing/scene.pscene", argv[2]);
+	char* paged_paths[] = {unwritable_path, argv[2]};
+
+	Scene_Pager pager = {};
+	DEFER(CloseScenePages(&pager));
+
+	if (!CHECK(OpenScenePages(&pager, argv[1], paged_paths, ARRAY_SIZE(paged_paths), 2*sizeof(Scene_Page_Data)))) return 1;
+	CHECK(GetFileModifiedTime(argv[2]) != 0);
+
+	CHECK(pager.slot_count == 2);
+	CHECK(pager.page_count > 8*pager.slot_count);
+
+	/// Conversion keeps every triangle, and lights still point at their triangle
+	{
+		FILE* scene_file = fopen(argv[1], "rb");
+		u32 tri_count    = 0;
+		if (CHECK(scene_file != 0))
+		{
+			CHECK(fread(&tri_count, sizeof(tri_count), 1, scene_file) == 1);
+			fclose(scene_file);
+		}
+
+		u32 paged_tri_count = 0;
+		for (u32 page = 0; page < pager.page_count; ++page) paged_tri_count += pager.pages[page].tri_count;
+		CHECK(paged_tri_count == tri_count);
+
+		Scene_Page_Data* data = (Scene_Page_Data*)malloc(sizeof(Scene_Page_Data));
+		for (u32 i = 0; i < pager.light_count; ++i)
+		{
+			u32 id = GetLightTriangleId(&pager.lights[i]);
+			CHECK(ReadScenePage(&pager, id/SCENE_PAGE_TRIANGLE_COUNT, data));
+			CHECK(memcmp(data->tri_data[id%SCENE_PAGE_TRIANGLE_COUNT].p0p2x, pager.lights[i].p0nx, 3*sizeof(float)) == 0);
+		}
+		free(data);
+	}
+
+	Upload_Log log = {};
+	log.pager      = &pager;
+
+	/// Fill the budget like LoadScene does
+	for (u32 page = 0; page < pager.slot_count; ++page)
+	{
+		i32 slot = ChooseEvictionSlot(&pager);
+		CHECK(slot != -1);
+		CHECK(AssignPageToSlot(&pager, page, slot) == -1);
+	}
+	CheckResidency(&pager);
+	CHECK(ChooseEvictionSlot(&pager) == -1);
+
+	/// Eviction picks the least recently used page, and never one used this tick
+	{
+		u32* feedback = (u32*)calloc(pager.page_count, sizeof(u32));
+
+		feedback[0] = 1;
+		ProcessPageFeedback(&pager, feedback);
+		feedback[0] = 0;
+		feedback[1] = 1;
+		ProcessPageFeedback(&pager, feedback);
+		CHECK(ChooseEvictionSlot(&pager) == pager.pages[0].slot);
+
+		feedback[0] = 1;
+		ProcessPageFeedback(&pager, feedback);
+		CHECK(ChooseEvictionSlot(&pager) == -1);
+
+		feedback[1] = 0;
+		ProcessPageFeedback(&pager, feedback);
+		CHECK(ChooseEvictionSlot(&pager) == pager.pages[1].slot);
+
+		free(feedback);
+	}
+
+	/// A working set that fits is streamed in wherever it moves
+	for (u32 first = 0; first + 1 < pager.page_count; ++first)
+	{
+		u32 working_set[2] = {first, first + 1};
+		u32 hits[2]        = {1, 1};
+
+		bool is_resident = false;
+		for (int frame = 0; frame < 8 && !is_resident; ++frame)
+		{
+			SimulateFrame(&pager, working_set, hits, ARRAY_SIZE(working_set), &log);
+			is_resident = IsResident(&pager, working_set, ARRAY_SIZE(working_set));
+		}
+
+		CHECK(is_resident);
+	}
+	CHECK(!pager.is_overcommitted);
+	CHECK(log.upload_count >= pager.page_count - pager.slot_count);
+
+	/// A working set that doesn't fit converges to its most hit pages, and stays there instead of thrashing
+	{
+		u32 working_set[3] = {0, 1, 2};
+		u32 hits[3]        = {1, 100, 100};
+		u32 hot_pages[2]   = {1, 2};
+		for (int frame = 0; frame < 8; ++frame) SimulateFrame(&pager, working_set, hits, ARRAY_SIZE(working_set), &log);
+		CHECK(pager.is_overcommitted);
+		CHECK(IsResident(&pager, hot_pages, ARRAY_SIZE(hot_pages)));
+
+		u32 upload_count = log.upload_count;
+		for (int frame = 0; frame < 8; ++frame) SimulateFrame(&pager, working_set, hits, ARRAY_SIZE(working_set), &log);
+		CHECK(log.upload_count == upload_count);
+		CHECK(pager.missing_count == 1);
+
+		// NOTE: once page 0 is hit the most it replaces the coldest resident page
+		hits[0] = 1000;
+		hits[2] = 50;
+		u32 new_hot_pages[2] = {0, 1};
+		for (int frame = 0; frame < 8 && !IsResident(&pager, new_hot_pages, ARRAY_SIZE(new_hot_pages)); ++frame)
+		{
+			SimulateFrame(&pager, working_set, hits, ARRAY_SIZE(working_set), &log);
+		}
+		CHECK(IsResident(&pager, new_hot_pages, ARRAY_SIZE(new_hot_pages)));
+		CHECK(pager.pages[2].slot == -1);
+	}
+
+	/// Pages hit about equally often are not swapped back and forth
+	{
+		u32 working_set[3] = {3, 4, 5};
+		u32 hits[3]        = {100, 100, 100};
+		for (int frame = 0; frame < 8; ++frame) SimulateFrame(&pager, working_set, hits, ARRAY_SIZE(working_set), &log);
+		CHECK(pager.is_overcommitted);
+
+		u32 upload_count = log.upload_count;
+		for (int frame = 0; frame < 32; ++frame) SimulateFrame(&pager, working_set, hits, ARRAY_SIZE(working_set), &log);
+		CHECK(log.upload_count == upload_count);
+	}
+
+	/// An up to date paged file is reused, one from an older format is converted again
+	{
+		// NOTE: a marker in the header padding survives the file being reused, converting it again writes it as 0
+		CloseScenePages(&pager);
+
+		Scene_Page_File_Header header = {};
+		CHECK(ReadPagedFileHeader(argv[2], &header));
+		header._pad_0 = 0x5E5E5E5E;
+		CHECK(WritePagedFileHeader(argv[2], &header));
+
+		CHECK(OpenScenePages(&pager, argv[1], paged_paths, ARRAY_SIZE(paged_paths), 2*sizeof(Scene_Page_Data)));
+		CloseScenePages(&pager);
+
+		CHECK(ReadPagedFileHeader(argv[2], &header));
+		CHECK(header._pad_0 == 0x5E5E5E5E);
+
+		header.version = SCENE_PAGE_FILE_VERSION - 1;
+		CHECK(WritePagedFileHeader(argv[2], &header));
+
+		CHECK(OpenScenePages(&pager, argv[1], paged_paths, ARRAY_SIZE(paged_paths), 2*sizeof(Scene_Page_Data)));
+
+		CHECK(ReadPagedFileHeader(argv[2], &header));
+		CHECK(IsPageFileHeaderCurrent(&header));
+		CHECK(header._pad_0 == 0);
+	}
+
+	if (failure_count == 0) printf("scene_pages_test: all checks passed\n");
+	return (failure_count != 0);
+}